@@ -1,3 +1,7 @@
+#pragma once
+
+#include "tolerance.hpp"
+
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -76,26 +80,93 @@ public:
         return (b - a).cross(c - a).normalize();
     }
 
-    bool are_triangles_coplanar(const Triangle& other_tr) const  {
-
-        const coord_t epsilon_ = 0.00000001;
+    /** @brief are_triangles_coplanar - detect whether triangles with parallel planes lie in one plane
+     *  @param other_tr another triangle
+     *  @param epsilon  the largest distance between the planes
+     */
+    bool are_triangles_coplanar(const Triangle& other_tr, coord_t epsilon) const  {
 
         Vect<coord_t> norm = other_tr.normal();
         coord_t d1 = norm.count_dot(a); 
         coord_t d2 = norm.count_dot(other_tr.a); 
 
-        return std::abs(d2 - d1) < epsilon_; 
+        return std::abs(d2 - d1) < epsilon; 
+    }
+
+    /** @brief closest_point - the point of the triangle closest to the point
+     *  @param point vector
+     */
+    Vect<coord_t> closest_point(const Vect<coord_t>& point) const {
+
+        Vect<coord_t> ab = b - a, ac = c - a;
+
+        Vect<coord_t> ap = point - a;
+        coord_t d1 = ab.count_dot(ap), d2 = ac.count_dot(ap);
+        if (d1 <= 0 && d2 <= 0)
+            return a;
+
+        Vect<coord_t> bp = point - b;
+        coord_t d3 = ab.count_dot(bp), d4 = ac.count_dot(bp);
+        if (d3 >= 0 && d4 <= d3)
+            return b;
+
+        coord_t vc = d1 * d4 - d3 * d2;
+        if (vc <= 0 && d1 >= 0 && d3 <= 0)
+            return a + ab * (d1 / (d1 - d3));
+
+        Vect<coord_t> cp = point - c;
+        coord_t d5 = ab.count_dot(cp), d6 = ac.count_dot(cp);
+        if (d6 >= 0 && d5 <= d6)
+            return c;
+
+        coord_t vb = d5 * d2 - d1 * d6;
+        if (vb <= 0 && d2 >= 0 && d6 <= 0)
+            return a + ac * (d2 / (d2 - d6));
+
+        coord_t va = d3 * d6 - d5 * d4;
+        if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        coord_t denom = va + vb + vc;
+        if (denom == 0)    // degenerate triangle
+            return a;
+
+        return a + ab * (vb / denom) + ac * (vc / denom);
+    }
+};
+
+/** @brief Ray - points origin + dir * t, t > 0
+ */
+template<class coord_t>
+struct Ray final {
+    Vect<coord_t> origin;
+    Vect<coord_t> dir;
+};
+
+/** @brief Hit - result of ray casts and nearest triangle queries
+ *  distance - parameter t of the ray | distance to the point
+ */
+template<class coord_t>
+struct Hit final {
+    static constexpr uint64_t NO_INDEX = std::numeric_limits<uint64_t>::max();
+
+    uint64_t index    = NO_INDEX;
+    coord_t  distance = std::numeric_limits<coord_t>::infinity();
+
+    bool found() const {
+        return index != NO_INDEX;
     }
 };
 
 /** @brief Triangle_intersection - class with methods of algorithm detecting intersection
+ *  tolerance_t - policy of comparisons (see tolerance.hpp)
  */  
-template<class coord_t>
+template<class coord_t, class tolerance_t = Absolute_tolerance<coord_t>>
 class Triangle_intersection final {
 
 private:
 
-    const coord_t epsilon_ = 0.00000001;
+    tolerance_t tolerance_;
 
     /** @brief ray_intersects_triangle - detect the intersection of a ray(Triangle side) and another triangle 
      *  @param ray_origin vector 
@@ -106,32 +177,8 @@ private:
     bool ray_intersects_triangle(const Vect<coord_t>& ray_origin, const Vect<coord_t>& ray_dir, 
                                                                   const Triangle<coord_t>& tr) const { 
 
-        Vect<coord_t> vertex1 = tr.a, vertex2 = tr.b, vertex3 = tr.c;
-        Vect<coord_t> edge1 = vertex2 - vertex1;
-        Vect<coord_t> edge2 = vertex3 - vertex1;
-
-        Vect<coord_t> H = ray_dir.cross(edge2);
-        coord_t a = edge1.count_dot(H);
-
-        if (std::fabs(a) < epsilon_) 
-            return false;
-
-        coord_t f = 1 / a;
-        Vect<coord_t> S = ray_origin - vertex1;
-        coord_t u = f * (S.count_dot(H));
-
-        if (u < 0 || u > 1) 
-            return false;
-
-        Vect<coord_t> Q = S.cross(edge1);
-        coord_t v = f * ray_dir.count_dot(Q);
-
-        if (v < 0 || u + v > 1)
-            return false;
-        
-        coord_t t = f * edge2.count_dot(Q);
-
-        return (t > epsilon_ && t - epsilon_ < 1);   // intersection_point = ray_origin + ray_dir * t 
+        coord_t t = 0;
+        return (intersect_ray(ray_origin, ray_dir, tr, t) && t - tolerance_.ratio() < 1);   // the side ends at t = 1
     }
 
     bool point_in_triangle(const Vect<coord_t>& point, const Triangle<coord_t>& triangle) const {
@@ -144,7 +191,7 @@ private:
                                 v1.y * (v2.x * v3.z - v2.z * v3.x) + 
                                 v1.z * (v2.x * v3.y - v2.y * v3.x);
 
-        if (std::fabs(are_copmplanar) > epsilon_)
+        if (std::fabs(are_copmplanar) > tolerance_.volume(v1.cross(v2)))
             return false;           
 
         coord_t dot00 = v1.count_dot(v1);
@@ -154,14 +201,16 @@ private:
         coord_t dot12 = v2.count_dot(v3);
 
         coord_t denom = dot00 * dot11 - dot01 * dot01;
-        if (std::fabs(denom) < epsilon_)
+        if (std::fabs(denom) < tolerance_.degenerate([&]() { return dot00 * dot11; }))
             return false;           
         coord_t inv_denom = 1 / denom;
 
         coord_t u = (dot11 * dot02 - dot01 * dot12) * inv_denom;
         coord_t v = (dot00 * dot12 - dot01 * dot02) * inv_denom;
 
-        return (u >= -epsilon_) && (v >= -epsilon_) && (u + v <= 1 + epsilon_);
+        coord_t epsilon = tolerance_.ratio();
+
+        return (u >= -epsilon) && (v >= -epsilon) && (u + v <= 1 + epsilon);
     }
 
     bool are_planes_parallel(const Triangle<coord_t>& tr1, const Triangle<coord_t>& tr2) const {
@@ -170,7 +219,7 @@ private:
         Vect<coord_t> norm2 = tr2.normal();
         coord_t dot_product = norm1.count_dot(norm2);
 
-        return (dot_product > 1 - epsilon_ || dot_product < -(1 - epsilon_)); 
+        return (dot_product > 1 - tolerance_.ratio() || dot_product < -(1 - tolerance_.ratio())); 
     }
 
 public: 
@@ -178,6 +227,57 @@ public:
     std::vector<Triangle<coord_t>> triangle_array; 
     std::set<uint64_t>    set_index;    
 
+    /** @brief intersect_ray - Moller-Trumbore intersection of a ray and a triangle 
+     *  @param ray_origin vector 
+     *  @param ray_dir vector 
+     *  @param tr  tringle 
+     *  @param t   [out] intersection_point = ray_origin + ray_dir * t 
+     *  @return 1 - intersect | 0 - don't intersect 
+     */
+    bool intersect_ray(const Vect<coord_t>& ray_origin, const Vect<coord_t>& ray_dir, 
+                                   const Triangle<coord_t>& tr, coord_t& t) const { 
+
+        Vect<coord_t> vertex1 = tr.a, vertex2 = tr.b, vertex3 = tr.c;
+        Vect<coord_t> edge1 = vertex2 - vertex1;
+        Vect<coord_t> edge2 = vertex3 - vertex1;
+
+        Vect<coord_t> H = ray_dir.cross(edge2);
+        coord_t a = edge1.count_dot(H);
+
+        auto size = [&]() { return std::sqrt(ray_dir.count_dot(ray_dir) * edge1.count_dot(edge1) * edge2.count_dot(edge2)); };
+        if (std::fabs(a) < tolerance_.degenerate(size)) 
+            return false;
+
+        coord_t f = 1 / a;
+        Vect<coord_t> S = ray_origin - vertex1;
+        coord_t u = f * (S.count_dot(H));
+
+        if (u < 0 || u > 1) 
+            return false;
+
+        Vect<coord_t> Q = S.cross(edge1);
+        coord_t v = f * ray_dir.count_dot(Q);
+
+        if (v < 0 || u + v > 1)
+            return false;
+        
+        t = f * edge2.count_dot(Q);
+
+        return (t > tolerance_.ratio());
+    }
+
+    /** @brief fit_tolerance - pass the scale of the triangles to the tolerance policy
+     */
+    void fit_tolerance() {
+
+        coord_t scale = 0;
+        for (const Triangle<coord_t>& tr : triangle_array) {
+            for (const Vect<coord_t>& vertex : {tr.a, tr.b, tr.c})
+                scale = std::max({scale, std::fabs(vertex.x), std::fabs(vertex.y), std::fabs(vertex.z)});
+        }
+        tolerance_.set_scale(scale);
+    }
+
     /** @brief add triangle - push a new triangle into vector  
      *  @param tr new Triangle 
      */
@@ -211,7 +311,7 @@ public:
     bool intersects_triangle(const Triangle<coord_t>& tr1, const Triangle<coord_t>& tr2) const {
         
         if (are_planes_parallel(tr1, tr2)) {
-            if (!tr1.are_triangles_coplanar(tr2)) {
+            if (!tr1.are_triangles_coplanar(tr2, tolerance_.length())) {
                 return false; 
             }
         }
@@ -253,7 +353,50 @@ public:
 template<class coord_t>
 class Optimisation final {
 
+public:
+
+    static constexpr size_t PACKET_SIZE = 8;
+    static constexpr size_t MIN_PACKET  = 2;    // fewer active rays are traversed one by one
+
 private:
+
+    /** @brief Ray_packet - rays traversed together, coordinates are stored by lanes,
+     *  directions of all rays have the same signs, so they enter a box through the same planes
+     */
+    struct Ray_packet final {
+        coord_t origin_x[PACKET_SIZE], origin_y[PACKET_SIZE], origin_z[PACKET_SIZE];
+        coord_t inv_dir_x[PACKET_SIZE], inv_dir_y[PACKET_SIZE], inv_dir_z[PACKET_SIZE];
+        coord_t t_max[PACKET_SIZE];
+        bool    negative_x, negative_y, negative_z;
+    };
+
+    /** @brief Packet_boxes - parameters of the entry points of the rays of a packet into AABB,
+     *  NaN for the rays which miss it. A ray is active while entry <= t_max, NaN fails any comparison
+     */
+    struct Packet_boxes final {
+        coord_t entry[PACKET_SIZE];
+        coord_t first_entry;    // the closest entry of the active rays
+        size_t  number;         // number of the active rays
+
+        bool active(const Ray_packet& packet, size_t ray) const {
+            return entry[ray] <= packet.t_max[ray];
+        }
+
+        /** @brief count - count the active rays and find the closest entry
+         *  @return number of the active rays
+         */
+        size_t count(const Ray_packet& packet) {
+
+            first_entry = std::numeric_limits<coord_t>::infinity();
+            number      = 0;
+            for (size_t i = 0; i < PACKET_SIZE; ++i) {
+                bool is_active = active(packet, i);
+                first_entry = std::min(first_entry, is_active ? entry[i] : std::numeric_limits<coord_t>::infinity());
+                number     += is_active;
+            }
+            return number;
+        }
+    };
     /** @brief AABB (axis-aligned bounding box)
     */
     class AABB final {
@@ -324,23 +467,158 @@ private:
     
             return true;
         }
+
+        /** @brief clip_slab - clip the interval [t_near, t_far] of a ray by the slab of one axis
+         *  @param t1, t2 - parameters of the planes of the slab
+         *  NaN comes from an origin on a plane of the slab and a zero direction, the ray is inside 
+         *  the slab then. std::max(a, b) and std::min(a, b) return a if b is NaN, so
+         *  max(t_near, min(t1, t2)) = min(max(t_near, t1), max(t_near, t2)) skips a NaN parameter
+         *  without branches
+         */
+        static void clip_slab(coord_t t1, coord_t t2, coord_t& t_near, coord_t& t_far) {
+
+            t_near = std::min(std::max(t_near, t1), std::max(t_near, t2));
+            t_far  = std::max(std::min(t_far,  t1), std::min(t_far,  t2));
+        }
+
+        /** @brief intersects_ray - slab test of a ray and AABB
+         *  @param inv_dir 1 / ray direction
+         *  @param t_max   end of the ray
+         *  @param t_entry [out] parameter of the entry point
+         */
+        bool intersects_ray(const Vect<coord_t>& origin, const Vect<coord_t>& inv_dir, coord_t t_max, 
+                                                                                      coord_t& t_entry) const {
+            coord_t t_near = -std::numeric_limits<coord_t>::infinity();
+            coord_t t_far  =  std::numeric_limits<coord_t>::infinity();
+
+            clip_slab((min_point.x - origin.x) * inv_dir.x, (max_point.x - origin.x) * inv_dir.x, t_near, t_far);
+            clip_slab((min_point.y - origin.y) * inv_dir.y, (max_point.y - origin.y) * inv_dir.y, t_near, t_far);
+            clip_slab((min_point.z - origin.z) * inv_dir.z, (max_point.z - origin.z) * inv_dir.z, t_near, t_far);
+
+            t_entry = t_near;
+
+            /* a flat box of a triangle gives t_near = t_far up to rounding */
+            return (t_near <= widen(t_far) && t_far >= 0 && t_near <= t_max);
+        }
+
+        /** @brief intersects_rays - slab test of each ray of a packet, the planes of entry and exit 
+         *  are chosen once for the packet, so the loop over lanes is vectorized
+         *  @param result [out] entry points of the rays
+         *  @return number of the active rays
+         */
+        size_t intersects_rays(const Ray_packet& packet, Packet_boxes& result) const {
+
+            coord_t near_x = packet.negative_x ? max_point.x : min_point.x;
+            coord_t near_y = packet.negative_y ? max_point.y : min_point.y;
+            coord_t near_z = packet.negative_z ? max_point.z : min_point.z;
+            coord_t far_x  = packet.negative_x ? min_point.x : max_point.x;
+            coord_t far_y  = packet.negative_y ? min_point.y : max_point.y;
+            coord_t far_z  = packet.negative_z ? min_point.z : max_point.z;
+
+            /* lanes are written into a local copy, it does not alias the packet */
+            Packet_boxes boxes;
+
+            for (size_t i = 0; i < PACKET_SIZE; ++i) {
+                coord_t t_near = -std::numeric_limits<coord_t>::infinity();
+                coord_t t_far  =  std::numeric_limits<coord_t>::infinity();
+
+                /* NaN of a ray in a plane of the slab is skipped, as in clip_slab */
+                t_near = std::max(t_near, (near_x - packet.origin_x[i]) * packet.inv_dir_x[i]);
+                t_near = std::max(t_near, (near_y - packet.origin_y[i]) * packet.inv_dir_y[i]);
+                t_near = std::max(t_near, (near_z - packet.origin_z[i]) * packet.inv_dir_z[i]);
+                t_far  = std::min(t_far,  (far_x  - packet.origin_x[i]) * packet.inv_dir_x[i]);
+                t_far  = std::min(t_far,  (far_y  - packet.origin_y[i]) * packet.inv_dir_y[i]);
+                t_far  = std::min(t_far,  (far_z  - packet.origin_z[i]) * packet.inv_dir_z[i]);
+
+                bool hit = (t_near <= widen(t_far)) & (t_far >= 0);
+                boxes.entry[i] = hit ? t_near : std::numeric_limits<coord_t>::quiet_NaN();
+            }
+
+            result = boxes;
+            return result.count(packet);
+        }
+
+        coord_t squared_distance(const Vect<coord_t>& point) const {
+
+            coord_t dx = std::max({min_point.x - point.x, coord_t(0), point.x - max_point.x});
+            coord_t dy = std::max({min_point.y - point.y, coord_t(0), point.y - max_point.y});
+            coord_t dz = std::max({min_point.z - point.z, coord_t(0), point.z - max_point.z});
+
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        /** @brief intersects - separating axis test of a triangle and AABB, touching counts
+         *  @param tr triangle
+         */
+        bool intersects(const Triangle<coord_t>& tr) const {
+
+            Vect<coord_t> center = (min_point + max_point) / 2;
+            Vect<coord_t> half   = (max_point - min_point) / 2;
+
+            Vect<coord_t> v0 = tr.a - center, v1 = tr.b - center, v2 = tr.c - center;
+
+            /* axes of the box */
+            if (std::max({v0.x, v1.x, v2.x}) < -half.x || std::min({v0.x, v1.x, v2.x}) > half.x) 
+                return false;
+            if (std::max({v0.y, v1.y, v2.y}) < -half.y || std::min({v0.y, v1.y, v2.y}) > half.y) 
+                return false;
+            if (std::max({v0.z, v1.z, v2.z}) < -half.z || std::min({v0.z, v1.z, v2.z}) > half.z) 
+                return false;
+
+            /* cross products of the axes and the sides */
+            auto separates = [&](const Vect<coord_t>& axis) {
+                coord_t p0 = axis.count_dot(v0), p1 = axis.count_dot(v1), p2 = axis.count_dot(v2);
+                coord_t r  = half.x * std::fabs(axis.x) + half.y * std::fabs(axis.y) + half.z * std::fabs(axis.z);
+                return (std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r);
+            };
+            for (const Vect<coord_t>& side : {v1 - v0, v2 - v1, v0 - v2}) {
+                if (separates({0, -side.z, side.y}) || separates({side.z, 0, -side.x}) || 
+                                                       separates({-side.y, side.x, 0}))
+                    return false;
+            }
+
+            /* plane of the triangle */
+            return !separates((v1 - v0).cross(v2 - v0));
+        }
     };
 
 public:
 
     /** @brief node of bounding volume hierarchy (BVH)
+     *  nodes live in the node pool of Optimisation, triangles of a node are 
+     *  the range [first, first + count) of the sorted triangle buffer
      */
     struct BVH_node final {
         AABB bounding_box;
 
-        std::unique_ptr<BVH_node> left  = nullptr;
-        std::unique_ptr<BVH_node> right = nullptr;
+        BVH_node* left  = nullptr;
+        BVH_node* right = nullptr;
 
-        std::vector<Triangle<coord_t>> triangles;
+        size_t first = 0;
+        size_t count = 0;
 
-        BVH_node(const AABB& box) : bounding_box(box) {}
+        BVH_node(const AABB& box, size_t first, size_t count) : bounding_box(box), first(first), count(count) {}
     };
 
+private:
+
+    /* node pool: a tree with n leaves has at most 2n - 1 nodes, so the pool is reserved
+       once per build and pointers into it stay valid. Buffers keep their capacity between 
+       builds and are released in bulk with the Optimisation object */
+    std::vector<BVH_node>          nodes_;
+    std::vector<Triangle<coord_t>> triangles_;
+    std::vector<AABB>              split_boxes_;
+
+public:
+
+    /* a copy of the nodes would point into the pool of the source,
+       a move keeps the buffer of the pool, so the tree stays valid */
+    Optimisation() = default;
+    Optimisation(const Optimisation&) = delete;
+    Optimisation& operator=(const Optimisation&) = delete;
+    Optimisation(Optimisation&&) = default;
+    Optimisation& operator=(Optimisation&&) = default;
+
 private:
 
     /** @brief create_bounding_box - create AABB for the triangles 
@@ -357,9 +635,8 @@ private:
         }
         return box;
     }
-    template<typename iterator_t>
-    static size_t find_best_split(iterator_t it_begin, 
-                                  iterator_t it_end, const Geometry::Optimisation<coord_t>::AABB& box) {
+
+    size_t find_best_split(size_t first, size_t count, const AABB& box) {
 
         coord_t best_cost  = std::numeric_limits<coord_t>::infinity();
         size_t  best_split = 0;
@@ -369,17 +646,20 @@ private:
         constexpr size_t MIDDLE_STEP = 10;
         constexpr size_t SMALL_STEP  = 2;
 
-        if ((it_end - it_begin) > BIG_STEP * 2) 
+        if (count > BIG_STEP * 2) 
             step = BIG_STEP;
-        else if ((it_end - it_begin) > MIDDLE_STEP * 2) 
+        else if (count > MIDDLE_STEP * 2) 
             step = MIDDLE_STEP;
-        else if ((it_end - it_begin) > SMALL_STEP * 2) 
+        else if (count > SMALL_STEP * 2) 
             step = SMALL_STEP;
         else 
             step = 1;
 
         coord_t parent_area = box.surface_area();
 
+        auto it_begin = triangles_.begin() + first;
+        auto it_end   = it_begin + count;
+
         /* sort by x */
         std::sort(it_begin, it_end, [](const Triangle<coord_t>& tr1, const Triangle<coord_t>& tr2) {  
             coord_t centroid_A = (tr1.a.x + tr1.b.x + tr1.c.x) / 3.0f;
@@ -387,20 +667,36 @@ private:
             return centroid_A < centroid_B;
         });
 
-        for (size_t i = step; i < (it_end - it_begin); i += step) { 
-            
-            AABB left_box  = create_bounding_box(it_begin, it_begin + i);
-            AABB right_box = create_bounding_box(it_begin + i, it_end);
+        /* split_boxes_[i] - AABB of the triangles [i, count) */
+        split_boxes_.resize(count + 1);
+        split_boxes_[count] = AABB{};
+        for (size_t i = count; i-- > 0;) {
+            split_boxes_[i] = split_boxes_[i + 1];
+            split_boxes_[i].expand(it_begin[i].a);
+            split_boxes_[i].expand(it_begin[i].b);
+            split_boxes_[i].expand(it_begin[i].c);
+        }
+
+        AABB   left_box = {};
+        size_t in_left  = 0;
+
+        for (size_t i = step; i < count; i += step) { 
+
+            for (; in_left < i; ++in_left) {
+                left_box.expand(it_begin[in_left].a);
+                left_box.expand(it_begin[in_left].b);
+                left_box.expand(it_begin[in_left].c);
+            }
+            const AABB& right_box = split_boxes_[i];
 
             coord_t left_area  = left_box.surface_area();
             coord_t right_area = right_box.surface_area();
 
             coord_t sah_cost = 2.0f + (left_area / parent_area) * i + 
-                                     (right_area / parent_area) * (it_end - it_begin - i) +
-                                     0.1f * (std::max(i, (it_end - it_begin - i)) - 
-                                             std::min(i, (it_end - it_begin - i)));
+                                     (right_area / parent_area) * (count - i) +
+                                     0.1f * (std::max(i, count - i) - std::min(i, count - i));
 
-            if (sah_cost < best_cost && !(i == 0) && !(it_end - it_begin - i == 0)) {
+            if (sah_cost < best_cost && !(i == 0) && !(count - i == 0)) {
                 best_cost = sah_cost;
                 best_split = i;
             }
@@ -409,32 +705,24 @@ private:
         return best_split;
     }
 
-public:
+    BVH_node* build_node(size_t first, size_t count) {
 
-    /** @brief build_BVH - recursively build BVH tree
-     *  @param 2 iterators of tringles vector 
-     */
-    template<typename iterator_t>
-    std::unique_ptr<BVH_node> build_BVH(iterator_t it_begin, 
-                                        iterator_t it_end) {
+        auto it_begin = triangles_.begin() + first;
+        auto it_end   = it_begin + count;
 
-        if ((it_end - it_begin) == 1) {
-
-            auto leaf_node = std::make_unique<BVH_node>(create_bounding_box(it_begin, it_end));
-            leaf_node->triangles = std::vector<Triangle<coord_t>>(it_begin, it_end);
-            
-            return leaf_node;
-        }
         AABB box = create_bounding_box(it_begin, it_end);
+        if (count == 1) {
+            nodes_.emplace_back(box, first, count);
+            return &nodes_.back();
+        }
 
-        size_t best_split = find_best_split(it_begin, it_end, box);
+        size_t best_split = find_best_split(first, count, box);
 
-        if (best_split == 0 || best_split == (it_end - it_begin)) {
-            auto leaf_node = std::make_unique<BVH_node>(box);
-            leaf_node->triangles = std::vector<Triangle<coord_t>>(it_begin, it_end);
-            
-            return leaf_node;
-        }
+        nodes_.emplace_back(box, first, count);
+        BVH_node* node = &nodes_.back();
+
+        if (best_split == 0 || best_split == count) 
+            return node;
         
         #ifndef NDEBUG
             for (auto tr_it = it_begin; tr_it < it_begin + best_split; ++tr_it)
@@ -443,28 +731,64 @@ public:
                 std::cout << "right ind " << tr_it->index << '\n';
         #endif
 
-        auto node = std::make_unique<BVH_node>(box);
-        node->triangles = std::vector<Triangle<coord_t>>(it_begin, it_end);
-        
-        node->left  = build_BVH(it_begin, it_begin + best_split);
+        node->left  = build_node(first, best_split);
 
-        node->right = build_BVH(it_begin + best_split, it_end);
+        node->right = build_node(first + best_split, count - best_split);
        
         return node;
-    
     }
-    /** @brief check_BVH_intersection - detect intersection between leafs or subtrees
+
+public:
+
+    /** @brief build_BVH - build BVH tree, the previous tree of this object is released
+     *  @param 2 iterators of tringles vector 
+     *  @return root of the tree, owned by the Optimisation object
+     */
+    template<typename iterator_t>
+    BVH_node* build_BVH(iterator_t it_begin, 
+                        iterator_t it_end) {
+
+        nodes_.clear();
+        triangles_.assign(it_begin, it_end);
+
+        if (triangles_.empty())
+            return nullptr;
+
+        nodes_.reserve(2 * triangles_.size() - 1);
+
+        return build_node(0, triangles_.size());
+    }
+
+    /** @brief check_BVH_intersection - detect intersection between leafs or subtrees,
+     *  indexes of intersecting triangles are put into tr_int.set_index
      *  @param node1 - right node of a subtree
      *  @param node2 - left node of a subtree
      */
-    static void check_BVH_intersection(std::unique_ptr<BVH_node>& node1, std::unique_ptr<BVH_node>& node2,
-                                                                     Triangle_intersection<coord_t>& tr_int) {
+    template<class tolerance_t>
+    void check_BVH_intersection(const BVH_node* node1, const BVH_node* node2,
+                                Triangle_intersection<coord_t, tolerance_t>& tr_int) const {
+
+        check_BVH_intersection(node1, node2, tr_int, [&tr_int](uint64_t index) { tr_int.set_index.insert(index); });
+    }
+
+    /** @brief check_BVH_intersection - detect intersection between leafs or subtrees
+     *  @param node1  - right node of a subtree
+     *  @param node2  - left node of a subtree
+     *  @param on_hit - called with the index of each triangle of an intersecting pair, 
+     *                  a triangle may be reported several times
+     */
+    template<class tolerance_t, typename callback_t>
+    void check_BVH_intersection(const BVH_node* node1, const BVH_node* node2,
+                                const Triangle_intersection<coord_t, tolerance_t>& tr_int, callback_t&& on_hit) const {
+
+    if (!node1 || !node2)
+        return;
 
     if (node1->left && node1->right) {          
-        check_BVH_intersection(node1->left, node1->right, tr_int);
+        check_BVH_intersection(node1->left, node1->right, tr_int, on_hit);
     }
     if (node2->left && node2->right) {         
-        check_BVH_intersection(node2->left, node2->right, tr_int);
+        check_BVH_intersection(node2->left, node2->right, tr_int, on_hit);
     }
 
     if (!node1->bounding_box.intersects(node2->bounding_box)) {  
@@ -476,8 +800,10 @@ public:
 
     if ((!node1->left && !node1->right) || (!node2->left && !node2->right)) {  // intersetc triangles, if one of them is a leaf
       
-        for (auto& t1 : node1->triangles) {
-            for (auto& t2 : node2->triangles) {
+        for (size_t i = node1->first; i < node1->first + node1->count; ++i) {
+            for (size_t j = node2->first; j < node2->first + node2->count; ++j) {
+                const Triangle<coord_t>& t1 = triangles_[i];
+                const Triangle<coord_t>& t2 = triangles_[j];
                 #ifndef NDEBUG
                     std::cout << "tr1: " << t1.index << '\n';
                     std::cout << "tr2: " << t2.index << '\n';
@@ -487,8 +813,8 @@ public:
                         std::cout << "Intersection between triangle " << t1.index
                                   << " and triangle " << t2.index << std::endl;
                     #endif
-                    tr_int.set_index.insert(t1.index);
-                    tr_int.set_index.insert(t2.index);
+                    on_hit(t1.index);
+                    on_hit(t2.index);
                 }
             }
         }
@@ -496,18 +822,318 @@ public:
     }
 
     if (node1->left && node2->right) {
-        check_BVH_intersection(node1->left, node2->right, tr_int);
+        check_BVH_intersection(node1->left, node2->right, tr_int, on_hit);
     }
     if (node1->right && node2->left) {
-        check_BVH_intersection(node1->right, node2->left, tr_int);
+        check_BVH_intersection(node1->right, node2->left, tr_int, on_hit);
     }
     if (node1->left && node2->left) {
-        check_BVH_intersection(node1->left, node2->left, tr_int);
+        check_BVH_intersection(node1->left, node2->left, tr_int, on_hit);
     }
     if (node1->right && node2->right) {
-        check_BVH_intersection(node1->right, node2->right, tr_int);
+        check_BVH_intersection(node1->right, node2->right, tr_int, on_hit);
     }
 }
+
+    /** @brief find_intersecting - find triangles of a subtree which intersect the triangle
+     *  @param node   - root of a subtree
+     *  @param tr     - triangle
+     *  @param on_hit - called with the index of each intersecting triangle
+     */
+    template<class tolerance_t, typename callback_t>
+    void find_intersecting(const BVH_node* node, const Triangle<coord_t>& tr, 
+                           const Triangle_intersection<coord_t, tolerance_t>& tr_int, callback_t&& on_hit) const {
+
+        if (!node)
+            return;
+
+        AABB tr_box = create_bounding_box(&tr, &tr + 1);
+        find_intersecting(node, tr, tr_box, tr_int, on_hit);
+    }
+
+private:
+
+    template<class tolerance_t, typename callback_t>
+    void find_intersecting(const BVH_node* node, const Triangle<coord_t>& tr, const AABB& tr_box,
+                           const Triangle_intersection<coord_t, tolerance_t>& tr_int, callback_t& on_hit) const {
+
+        if (!node->bounding_box.intersects(tr_box))
+            return;
+
+        if (node->left && node->right) {
+            find_intersecting(node->left,  tr, tr_box, tr_int, on_hit);
+            find_intersecting(node->right, tr, tr_box, tr_int, on_hit);
+            return;
+        }
+        for (size_t i = node->first; i < node->first + node->count; ++i) {
+            if (tr_int.intersects_triangle(triangles_[i], tr))
+                on_hit(triangles_[i].index);
+        }
+    }
+
+public:
+
+    /** @brief cast_ray - find the closest triangle hit by the ray
+     *  @param node - root of a subtree
+     *  @param ray  - ray
+     *  @return index of the triangle and parameter t of the hit point
+     */
+    template<class tolerance_t>
+    Hit<coord_t> cast_ray(const BVH_node* node, const Ray<coord_t>& ray, 
+                          const Triangle_intersection<coord_t, tolerance_t>& tr_int) const {
+
+        Hit<coord_t>  hit     = {};
+        Vect<coord_t> inv_dir = {1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z};
+        coord_t       t_entry = 0;
+
+        if (node && node->bounding_box.intersects_ray(ray.origin, inv_dir, hit.distance, t_entry))
+            cast_ray(node, ray, inv_dir, tr_int, hit);
+
+        return hit;
+    }
+
+    /** @brief cast_rays - cast a batch of rays by packets of PACKET_SIZE rays,
+     *  neighbouring rays of the batch should be coherent to share nodes of the tree
+     *  @param node - root of a subtree
+     *  @param 2 iterators of rays
+     *  @param hits [out] hit of each ray
+     */
+    template<class tolerance_t, typename iterator_t>
+    void cast_rays(const BVH_node* node, iterator_t it_begin, iterator_t it_end, 
+                   const Triangle_intersection<coord_t, tolerance_t>& tr_int, std::vector<Hit<coord_t>>& hits) const {
+
+        hits.assign(it_end - it_begin, Hit<coord_t>{});
+        if (!node)
+            return;
+
+        Ray_packet packet = {};
+        for (size_t first = 0; first < hits.size(); first += PACKET_SIZE) {
+
+            size_t count = std::min(PACKET_SIZE, hits.size() - first);
+            for (size_t i = 0; i < PACKET_SIZE; ++i) {
+                Ray<coord_t> ray = (i < count) ? *(it_begin + first + i) : Ray<coord_t>{};
+
+                packet.origin_x[i]  = ray.origin.x;
+                packet.origin_y[i]  = ray.origin.y;
+                packet.origin_z[i]  = ray.origin.z;
+                packet.inv_dir_x[i] = 1 / ray.dir.x;
+                packet.inv_dir_y[i] = 1 / ray.dir.y;
+                packet.inv_dir_z[i] = 1 / ray.dir.z;
+                packet.t_max[i]     = std::numeric_limits<coord_t>::infinity();
+
+                if (i >= count) {   // unused lane misses every box: t_near = t_far = 0 > t_max
+                    packet.inv_dir_x[i] = packet.inv_dir_y[i] = packet.inv_dir_z[i] = 0;
+                    packet.t_max[i]     = -std::numeric_limits<coord_t>::infinity();
+                }
+            }
+
+            /* rays with directions of different signs do not share boxes, they are cast one by one */
+            packet.negative_x = std::signbit(packet.inv_dir_x[0]);
+            packet.negative_y = std::signbit(packet.inv_dir_y[0]);
+            packet.negative_z = std::signbit(packet.inv_dir_z[0]);
+
+            bool same_signs = true;
+            for (size_t i = 1; i < count; ++i) {
+                same_signs = same_signs && (std::signbit(packet.inv_dir_x[i]) == packet.negative_x) && 
+                                           (std::signbit(packet.inv_dir_y[i]) == packet.negative_y) && 
+                                           (std::signbit(packet.inv_dir_z[i]) == packet.negative_z);
+            }
+            if (!same_signs) {
+                for (size_t i = 0; i < count; ++i)
+                    hits[first + i] = cast_ray(node, *(it_begin + first + i), tr_int);
+                continue;
+            }
+
+            Packet_boxes boxes;
+            if (node->bounding_box.intersects_rays(packet, boxes))
+                cast_packet(node, it_begin + first, count, packet, boxes, tr_int, hits.data() + first);
+        }
+    }
+
+    /** @brief find_in_box - find triangles of a subtree which touch the box
+     *  @param node   - root of a subtree
+     *  @param min_point, max_point - corners of the box
+     *  @param on_hit - called with the index of each triangle
+     */
+    template<typename callback_t>
+    void find_in_box(const BVH_node* node, const Vect<coord_t>& min_point, const Vect<coord_t>& max_point, 
+                                                                          callback_t&& on_hit) const {
+        if (!node)
+            return;
+
+        find_in_box(node, AABB(min_point, max_point), on_hit);
+    }
+
+    /** @brief find_nearest - find the triangle of a subtree closest to the point
+     *  @param node  - root of a subtree
+     *  @param point - point
+     *  @return index of the triangle and the distance
+     */
+    Hit<coord_t> find_nearest(const BVH_node* node, const Vect<coord_t>& point) const {
+
+        Hit<coord_t> hit = {};
+        if (!node)
+            return hit;
+
+        find_nearest(node, point, hit);
+        hit.distance = std::sqrt(hit.distance);
+
+        return hit;
+    }
+
+private:
+
+    /* the closest hit wins, the smaller index wins a tie */
+    static bool is_closer(coord_t distance, uint64_t index, const Hit<coord_t>& hit) {
+        return distance < hit.distance || (distance == hit.distance && index < hit.index);
+    }
+
+    /* boxes are visited up to a slightly larger distance than the current hit: the entry of a box 
+       may round above a hit of the same distance, and a triangle of a tie would be skipped.
+       So the result does not depend on the order of traversal */
+    static coord_t widen(coord_t distance) {
+        return distance + std::fabs(distance) * 4096 * std::numeric_limits<coord_t>::epsilon();
+    }
+
+    template<class tolerance_t>
+    void cast_ray(const BVH_node* node, const Ray<coord_t>& ray, const Vect<coord_t>& inv_dir,
+                  const Triangle_intersection<coord_t, tolerance_t>& tr_int, Hit<coord_t>& hit) const {
+
+        if (!(node->left && node->right)) {
+            coord_t t = 0;
+            for (size_t i = node->first; i < node->first + node->count; ++i) {
+                if (tr_int.intersect_ray(ray.origin, ray.dir, triangles_[i], t) && is_closer(t, triangles_[i].index, hit)) {
+                    hit.index    = triangles_[i].index;
+                    hit.distance = t;
+                }
+            }
+            return;
+        }
+
+        /* the closer child first, it shortens the ray for the other one */
+        const BVH_node* near_node = node->left;
+        const BVH_node* far_node  = node->right;
+        coord_t t_near = 0, t_far = 0;
+
+        bool to_near = near_node->bounding_box.intersects_ray(ray.origin, inv_dir, widen(hit.distance), t_near);
+        bool to_far  = far_node->bounding_box.intersects_ray(ray.origin, inv_dir, widen(hit.distance), t_far);
+
+        if (to_near && to_far && t_far < t_near) {
+            std::swap(near_node, far_node);
+            std::swap(t_near, t_far);
+        }
+        else if (!to_near) {
+            std::swap(near_node, far_node);
+            std::swap(to_near, to_far);
+            std::swap(t_near, t_far);
+        }
+
+        if (to_near)
+            cast_ray(near_node, ray, inv_dir, tr_int, hit);
+        if (to_far && t_far <= widen(hit.distance))
+            cast_ray(far_node, ray, inv_dir, tr_int, hit);
+    }
+
+    /* 'boxes' - rays of the packet which intersect the box of the node */
+    template<class tolerance_t, typename iterator_t>
+    void cast_packet(const BVH_node* node, iterator_t rays, size_t count, Ray_packet& packet, const Packet_boxes& boxes,
+                     const Triangle_intersection<coord_t, tolerance_t>& tr_int, Hit<coord_t>* hits) const {
+
+        if (boxes.number <= MIN_PACKET) {
+            for (size_t ray = 0; ray < count; ++ray) {
+                if (!boxes.active(packet, ray))
+                    continue;
+
+                Vect<coord_t> inv_dir = {packet.inv_dir_x[ray], packet.inv_dir_y[ray], packet.inv_dir_z[ray]};
+                cast_ray(node, *(rays + ray), inv_dir, tr_int, hits[ray]);
+                packet.t_max[ray] = widen(hits[ray].distance);
+            }
+            return;
+        }
+
+        if (node->left && node->right) {
+
+            /* the child with the closest entry first, as in cast_ray */
+            const BVH_node* child[2] = {node->left, node->right};
+            Packet_boxes    child_boxes[2];
+
+            bool to_left  = child[0]->bounding_box.intersects_rays(packet, child_boxes[0]);
+            bool to_right = child[1]->bounding_box.intersects_rays(packet, child_boxes[1]);
+
+            size_t near = (to_right && (!to_left || child_boxes[1].first_entry < child_boxes[0].first_entry)) ? 1 : 0;
+            size_t far  = 1 - near;
+
+            if (child_boxes[near].number)
+                cast_packet(child[near], rays, count, packet, child_boxes[near], tr_int, hits);
+            if (child_boxes[far].number && child_boxes[far].count(packet))
+                cast_packet(child[far],  rays, count, packet, child_boxes[far],  tr_int, hits);
+            return;
+        }
+
+        coord_t t = 0;
+        for (size_t ray = 0; ray < count; ++ray) {
+            if (!boxes.active(packet, ray))
+                continue;
+
+            const Ray<coord_t>& cur_ray = *(rays + ray);
+            for (size_t i = node->first; i < node->first + node->count; ++i) {
+                if (tr_int.intersect_ray(cur_ray.origin, cur_ray.dir, triangles_[i], t) && 
+                                            is_closer(t, triangles_[i].index, hits[ray])) {
+                    hits[ray].index    = triangles_[i].index;
+                    hits[ray].distance = t;
+                    packet.t_max[ray]  = widen(t);
+                }
+            }
+        }
+    }
+
+    template<typename callback_t>
+    void find_in_box(const BVH_node* node, const AABB& box, callback_t& on_hit) const {
+
+        if (!node->bounding_box.intersects(box))
+            return;
+
+        if (node->left && node->right) {
+            find_in_box(node->left,  box, on_hit);
+            find_in_box(node->right, box, on_hit);
+            return;
+        }
+        for (size_t i = node->first; i < node->first + node->count; ++i) {
+            if (box.intersects(triangles_[i]))
+                on_hit(triangles_[i].index);
+        }
+    }
+
+    /* hit.distance is the squared distance during the search */
+    void find_nearest(const BVH_node* node, const Vect<coord_t>& point, Hit<coord_t>& hit) const {
+
+        if (!(node->left && node->right)) {
+            for (size_t i = node->first; i < node->first + node->count; ++i) {
+                Vect<coord_t> diff = triangles_[i].closest_point(point) - point;
+                coord_t distance = diff.count_dot(diff);
+                if (is_closer(distance, triangles_[i].index, hit)) {
+                    hit.index    = triangles_[i].index;
+                    hit.distance = distance;
+                }
+            }
+            return;
+        }
+
+        const BVH_node* near_node = node->left;
+        const BVH_node* far_node  = node->right;
+        coord_t d_near = near_node->bounding_box.squared_distance(point);
+        coord_t d_far  = far_node->bounding_box.squared_distance(point);
+
+        if (d_far < d_near) {
+            std::swap(near_node, far_node);
+            std::swap(d_near, d_far);
+        }
+
+        if (d_near <= widen(hit.distance))
+            find_nearest(near_node, point, hit);
+        if (d_far <= widen(hit.distance))
+            find_nearest(far_node, point, hit);
+    }
 };
 }
 
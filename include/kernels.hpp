@@ -0,0 +1,25 @@
+#pragma once
+
+#include "tolerance.hpp"
+
+#include <istream>
+#include <ostream>
+
+/*  Precompiled kernels: the program for float and double coordinates with each
+ *  tolerance policy is compiled once in src/kernels.cpp, the BVH and the triangle test
+ *  are not instantiated by the includers of this header
+ */
+namespace Geometry {
+
+/** @brief run_intersection - intersections of a mesh read from 'in' or the daemon (see Mesh_service)
+ *  @param daemon 1 - serve commands | 0 - print indexes of intersecting triangles of one mesh
+ *  @return 0 - success | -1 - incorrect input
+ */
+template<class coord_t, class tolerance_t>
+int run_intersection(std::istream& in, std::ostream& out, bool daemon);
+
+extern template int run_intersection<double, Absolute_tolerance<double>>(std::istream&, std::ostream&, bool);
+extern template int run_intersection<double, Relative_tolerance<double>>(std::istream&, std::ostream&, bool);
+extern template int run_intersection<float,  Absolute_tolerance<float>> (std::istream&, std::ostream&, bool);
+extern template int run_intersection<float,  Relative_tolerance<float>> (std::istream&, std::ostream&, bool);
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "intersection_of_triangles.hpp"
+
+#include <istream>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+namespace Geometry {
+
+/** @brief Mesh_index - library API: a mesh with its BVH tree and intersection queries
+ *  results of the queries are sorted indexes of triangles written into the caller's vector
+ *  tolerance_t - policy of comparisons (see tolerance.hpp)
+ */
+template<class coord_t, class tolerance_t = Absolute_tolerance<coord_t>>
+class Mesh_index final {
+
+private:
+
+    Triangle_intersection<coord_t, tolerance_t>  tr_int_;
+    Optimisation<coord_t>                        opt_;
+    typename Optimisation<coord_t>::BVH_node*    root_  = nullptr;
+    bool                                         built_ = false;
+
+    std::vector<char> hit_;  // marks of triangles found by a query
+
+    void collect_hits(std::vector<uint64_t>& result) const {
+
+        result.clear();
+        for (uint64_t i = 0; i < hit_.size(); ++i) {
+            if (hit_[i])
+                result.push_back(i);
+        }
+    }
+
+public:
+
+    /* root_ points into the node pool of opt_, so the index is move-only,
+       the moved-from index is empty */
+    Mesh_index() = default;
+    Mesh_index(const Mesh_index&) = delete;
+    Mesh_index& operator=(const Mesh_index&) = delete;
+
+    Mesh_index(Mesh_index&& other) noexcept : tr_int_(std::move(other.tr_int_)), opt_(std::move(other.opt_)),
+                                              root_(other.root_), built_(other.built_), hit_(std::move(other.hit_)) {
+        other.clear();
+    }
+
+    Mesh_index& operator=(Mesh_index&& other) noexcept {
+
+        if (this != &other) {
+            tr_int_ = std::move(other.tr_int_);
+            opt_    = std::move(other.opt_);
+            root_   = other.root_;
+            built_  = other.built_;
+            hit_    = std::move(other.hit_);
+            other.clear();
+        }
+        return *this;
+    }
+
+    /** @brief load_mesh - read a mesh: number of triangles and coordinates of each triangle
+     *  @param in input stream
+     *  @return 1 - mesh is loaded | 0 - incorrect input, the mesh is empty
+     */
+    bool load_mesh(std::istream& in) {
+
+        clear();
+
+        int64_t number_tr = 0;
+        if (!(in >> number_tr) || (number_tr <= 0))
+            return false;
+
+        coord_t x1, y1, z1, x2, y2, z2, x3, y3, z3;
+        for (int64_t i = 0; i < number_tr; ++i) {
+            if (!(in >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3)) {
+                clear();
+                return false;
+            }
+            add_triangle(Triangle<coord_t>({x1, y1, z1}, {x2, y2, z2}, {x3, y3, z3}));
+        }
+        return true;
+    }
+
+    /** @brief add_triangle - add a triangle to the mesh, the index has to be rebuilt
+     *  @param tr new Triangle
+     */
+    void add_triangle(const Triangle<coord_t>& tr) {
+
+        tr_int_.add_triangle(tr);
+        built_ = false;
+    }
+
+    void clear() {
+
+        tr_int_.triangle_array.clear();
+        root_  = nullptr;
+        built_ = false;
+    }
+
+    /** @brief build_index - build BVH tree of the mesh, queries build it on demand
+     */
+    void build_index() {
+
+        tr_int_.fit_tolerance();
+        root_  = opt_.build_BVH(tr_int_.triangle_array.begin(), tr_int_.triangle_array.end());
+        built_ = true;
+    }
+
+    size_t size() const {
+        return tr_int_.triangle_array.size();
+    }
+
+    const std::vector<Triangle<coord_t>>& triangles() const {
+        return tr_int_.triangle_array;
+    }
+
+    /** @brief query_self - find triangles of the mesh which intersect other triangles of the mesh
+     *  @param result indexes of triangles
+     *  @return number of triangles
+     */
+    size_t query_self(std::vector<uint64_t>& result) {
+
+        if (!built_)
+            build_index();
+
+        hit_.assign(size(), 0);
+        if (root_)
+            opt_.check_BVH_intersection(root_->left, root_->right, tr_int_, [this](uint64_t index) { hit_[index] = 1; });
+
+        collect_hits(result);
+        return result.size();
+    }
+
+    /** @brief query_triangle - find triangles of the mesh which intersect the triangle
+     *  @param tr     triangle
+     *  @param result indexes of triangles
+     *  @return number of triangles
+     */
+    size_t query_triangle(const Triangle<coord_t>& tr, std::vector<uint64_t>& result) {
+
+        if (!built_)
+            build_index();
+
+        /* leafs of the tree do not share triangles, so each triangle is found once */
+        result.clear();
+        opt_.find_intersecting(root_, tr, tr_int_, [&result](uint64_t index) { result.push_back(index); });
+        std::sort(result.begin(), result.end());
+
+        return result.size();
+    }
+
+    /** @brief query_range - find triangles of the mesh which intersect any triangle of the range
+     *  @param 2 iterators of triangles
+     *  @param result indexes of triangles
+     *  @return number of triangles
+     */
+    template<typename iterator_t>
+    size_t query_range(iterator_t it_begin, iterator_t it_end, std::vector<uint64_t>& result) {
+
+        if (!built_)
+            build_index();
+
+        hit_.assign(size(), 0);
+        for (auto tr_it = it_begin; tr_it != it_end; ++tr_it)
+            opt_.find_intersecting(root_, *tr_it, tr_int_, [this](uint64_t index) { hit_[index] = 1; });
+
+        collect_hits(result);
+        return result.size();
+    }
+
+    /** @brief cast_ray - find the closest triangle hit by the ray
+     *  @param ray ray
+     *  @return index of the triangle and parameter t of the hit point, Hit::found() = 0 if nothing is hit
+     */
+    Hit<coord_t> cast_ray(const Ray<coord_t>& ray) {
+
+        if (!built_)
+            build_index();
+
+        return opt_.cast_ray(root_, ray, tr_int_);
+    }
+
+    /** @brief cast_rays - cast a batch of rays, coherent rays are traversed by packets
+     *  @param 2 iterators of rays
+     *  @param hits [out] hit of each ray
+     */
+    template<typename iterator_t>
+    void cast_rays(iterator_t it_begin, iterator_t it_end, std::vector<Hit<coord_t>>& hits) {
+
+        if (!built_)
+            build_index();
+
+        opt_.cast_rays(root_, it_begin, it_end, tr_int_, hits);
+    }
+
+    /** @brief query_box - find triangles of the mesh which touch the box
+     *  @param min_point, max_point corners of the box
+     *  @param result indexes of triangles
+     *  @return number of triangles
+     */
+    size_t query_box(const Vect<coord_t>& min_point, const Vect<coord_t>& max_point, std::vector<uint64_t>& result) {
+
+        if (!built_)
+            build_index();
+
+        result.clear();
+        opt_.find_in_box(root_, min_point, max_point, [&result](uint64_t index) { result.push_back(index); });
+        std::sort(result.begin(), result.end());
+
+        return result.size();
+    }
+
+    /** @brief query_nearest - find the triangle of the mesh closest to the point
+     *  @param point point
+     *  @return index of the triangle and the distance
+     */
+    Hit<coord_t> query_nearest(const Vect<coord_t>& point) {
+
+        if (!built_)
+            build_index();
+
+        return opt_.find_nearest(root_, point);
+    }
+
+    /** @brief query_other - find triangles of the mesh which intersect triangles of another mesh
+     *  @param other  another mesh
+     *  @param result indexes of triangles of this mesh
+     *  @return number of triangles
+     */
+    size_t query_other(const Mesh_index& other, std::vector<uint64_t>& result) {
+
+        return query_range(other.triangles().begin(), other.triangles().end(), result);
+    }
+};
+}
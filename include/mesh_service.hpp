@@ -0,0 +1,277 @@
+#pragma once
+
+#include "mesh_index.hpp"
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+namespace Geometry {
+
+/** @brief Mesh_service - long-lived mode: meshes and their BVH trees stay in memory
+ *  and serve commands read from a stream
+ *
+ *  load  <name> <n> <coordinates of n triangles>  -> ok <n>
+ *  self  <name>                                   -> <count> <indexes>
+ *  other <name> <other name>                      -> <count> <indexes>
+ *  range <name> <k> <coordinates of k triangles>  -> k lines: <count> <indexes>
+ *  ray   <name> <k> <k origins and directions>    -> k lines: <index> <t> | -1
+ *  box   <name> <min point> <max point>           -> <count> <indexes>
+ *  nearest <name> <k> <k points>                  -> k lines: <index> <distance>
+ *  drop  <name>                                   -> ok
+ *  stats                                          -> queries <q> seconds <s> qps <q/s>
+ *  quit
+ *  an incorrect command is answered with 'error <message>', the rest of its line is skipped
+ */
+template<class coord_t, class tolerance_t = Absolute_tolerance<coord_t>>
+class Mesh_service final {
+
+private:
+
+    using mesh_t = Mesh_index<coord_t, tolerance_t>;
+
+    std::map<std::string, mesh_t> meshes_;
+    mesh_t                        spare_;   // a mesh being loaded, it takes the buffers of the replaced mesh
+    mesh_t                        batch_;   // query triangles of a range command
+    std::vector<uint64_t>         result_;
+    std::vector<Ray<coord_t>>     rays_;
+    std::vector<Hit<coord_t>>     hits_;
+    std::vector<Vect<coord_t>>    batch_points_;
+
+    uint64_t queries_    = 0;
+    double   query_time_ = 0;
+
+    using clock_type = std::chrono::steady_clock;
+
+    void print_result(std::ostream& out) const {
+
+        out << result_.size();
+        for (uint64_t index : result_)
+            out << ' ' << index;
+        out << '\n';
+    }
+
+    static void print_hit(std::ostream& out, const Hit<coord_t>& hit) {
+
+        if (hit.found())
+            out << hit.index << ' ' << hit.distance << '\n';
+        else
+            out << "-1\n";
+    }
+
+    static bool read_vect(std::istream& in, Vect<coord_t>& vect) {
+        return static_cast<bool>(in >> vect.x >> vect.y >> vect.z);
+    }
+
+    /** @brief read_batch - read number of items and the items,
+     *  the batch grows only with items really read, so a wrong number allocates nothing
+     */
+    template<typename item_t, typename reader_t>
+    static bool read_batch(std::istream& in, std::vector<item_t>& batch, reader_t read_item) {
+
+        int64_t number = 0;
+        if (!(in >> number) || number <= 0)
+            return false;
+
+        batch.clear();
+        item_t item;
+        for (int64_t i = 0; i < number; ++i) {
+            if (!read_item(item))
+                return false;
+            batch.push_back(item);
+        }
+        return true;
+    }
+
+    void count_queries(uint64_t number, clock_type::time_point start) {
+
+        queries_    += number;
+        query_time_ += std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    mesh_t* find_mesh(const std::string& name, std::ostream& out) {
+
+        auto mesh_it = meshes_.find(name);
+        if (mesh_it == meshes_.end()) {
+            out << "error unknown mesh " << name << '\n';
+            return nullptr;
+        }
+        return &mesh_it->second;
+    }
+
+    /** @brief read_word - read a word of the current line
+     *  @return 0 - the line has ended
+     */
+    static bool read_word(std::istream& in, std::string& word) {
+
+        while (in.peek() == ' ' || in.peek() == '\t' || in.peek() == '\r')
+            in.get();
+        if (in.peek() == '\n' || in.peek() == std::char_traits<char>::eof())
+            return false;
+
+        return static_cast<bool>(in >> word);
+    }
+
+    /** @brief fail - report an error and skip the rest of the line, the service goes on
+     */
+    static void fail(std::istream& in, std::ostream& out, const std::string& message) {
+
+        out << "error " << message << '\n';
+        in.clear();
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    /** @brief execute - execute one command
+     *  @return 1 - continue | 0 - quit
+     */
+    bool execute(const std::string& command, std::istream& in, std::ostream& out) {
+
+        std::string name, other_name;
+
+        if (command == "quit")
+            return false;
+
+        if (command == "stats") {
+            out << "queries " << queries_ << " seconds " << query_time_ << " qps " << queries_per_second() << '\n';
+            return true;
+        }
+
+        if (command != "load" && command != "drop" && command != "self" && command != "other" && command != "range" &&
+            command != "ray"  && command != "box"  && command != "nearest") {
+            fail(in, out, "unknown command " + command);
+            return true;
+        }
+        if (!read_word(in, name)) {
+            fail(in, out, "incorrect input");
+            return true;
+        }
+
+        if (command == "load") {
+            /* a resident mesh with the same name is replaced only by a correct one */
+            if (!spare_.load_mesh(in)) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            spare_.build_index();
+            out << "ok " << spare_.size() << '\n';
+            std::swap(meshes_[name], spare_);
+        }
+        else if (command == "drop") {
+            meshes_.erase(name);
+            out << "ok\n";
+        }
+        else if (command == "self") {
+            if (mesh_t* mesh = find_mesh(name, out)) {
+                auto start = clock_type::now();
+                mesh->query_self(result_);
+                count_queries(1, start);
+                print_result(out);
+            }
+        }
+        else if (command == "other") {
+            if (!read_word(in, other_name)) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            mesh_t* mesh  = find_mesh(name, out);
+            mesh_t* other = mesh ? find_mesh(other_name, out) : nullptr;
+            if (mesh && other) {
+                auto start = clock_type::now();
+                mesh->query_other(*other, result_);
+                count_queries(1, start);
+                print_result(out);
+            }
+        }
+        else if (command == "range") {
+            if (!batch_.load_mesh(in)) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            if (mesh_t* mesh = find_mesh(name, out)) {
+                for (const Triangle<coord_t>& tr : batch_.triangles()) {
+                    auto start = clock_type::now();
+                    mesh->query_triangle(tr, result_);
+                    count_queries(1, start);
+                    print_result(out);
+                }
+            }
+        }
+        else if (command == "ray") {
+            if (!read_batch(in, rays_, [&in](Ray<coord_t>& ray) { return read_vect(in, ray.origin) && 
+                                                                         read_vect(in, ray.dir); })) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            if (mesh_t* mesh = find_mesh(name, out)) {
+                auto start = clock_type::now();
+                mesh->cast_rays(rays_.begin(), rays_.end(), hits_);
+                count_queries(rays_.size(), start);
+                for (const Hit<coord_t>& hit : hits_)
+                    print_hit(out, hit);
+            }
+        }
+        else if (command == "box") {
+            Vect<coord_t> min_point, max_point;
+            if (!read_vect(in, min_point) || !read_vect(in, max_point)) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            if (mesh_t* mesh = find_mesh(name, out)) {
+                auto start = clock_type::now();
+                mesh->query_box(min_point, max_point, result_);
+                count_queries(1, start);
+                print_result(out);
+            }
+        }
+        else if (command == "nearest") {
+            if (!read_batch(in, batch_points_, [&in](Vect<coord_t>& point) { return read_vect(in, point); })) {
+                fail(in, out, "incorrect input");
+                return true;
+            }
+            if (mesh_t* mesh = find_mesh(name, out)) {
+                auto start = clock_type::now();
+                hits_.clear();
+                for (const Vect<coord_t>& point : batch_points_)
+                    hits_.push_back(mesh->query_nearest(point));
+                count_queries(batch_points_.size(), start);
+                for (const Hit<coord_t>& hit : hits_)
+                    print_hit(out, hit);
+            }
+        }
+
+        return true;
+    }
+
+public:
+
+    /** @brief run - execute commands until quit or the end of input,
+     *  incorrect commands are answered with an error line and skipped
+     *  @return 0
+     */
+    int run(std::istream& in, std::ostream& out) {
+
+        std::string command;
+        while (in >> command) {
+            bool go_on = execute(command, in, out);
+            out.flush();
+            if (!go_on)
+                break;
+        }
+        return 0;
+    }
+
+    uint64_t queries() const {
+        return queries_;
+    }
+
+    double queries_per_second() const {
+        return query_time_ > 0 ? queries_ / query_time_ : 0;
+    }
+};
+}
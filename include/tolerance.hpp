@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+namespace Geometry {
+
+/** @brief Tolerance_traits - default tolerance of a coordinate type
+ */
+template<class coord_t>
+struct Tolerance_traits;
+
+template<>
+struct Tolerance_traits<double> final {
+    static constexpr double epsilon          = 0.00000001;
+    static constexpr double relative_epsilon = 0.000000000001;
+};
+
+template<>
+struct Tolerance_traits<float> final {
+    static constexpr float epsilon          = 0.00001f;
+    static constexpr float relative_epsilon = 0.00001f;
+};
+
+/*  Tolerance policies - template parameter of Triangle_intersection, each one gives
+ *  ratio()          - parameters of points on a triangle, cosines of normals
+ *  length()         - distance between parallel planes
+ *  degenerate(size) - values of degenerate triangles and rays parallel to a plane,
+ *                     size() is the value for perpendicular sides of the same lengths
+ *  volume(cross)    - triple product of a point and a triangle with cross product of sides 'cross'
+ *  set_scale(s)     - called with the largest absolute coordinate of the scene
+ */
+
+/** @brief Absolute_tolerance - the same tolerance for any scene,
+ *  it fits coordinates of order 1: degenerate values are products of lengths
+ */
+template<class coord_t>
+class Absolute_tolerance final {
+
+public:
+
+    static constexpr coord_t epsilon = Tolerance_traits<coord_t>::epsilon;
+
+    void set_scale(coord_t) {}
+
+    static constexpr coord_t ratio()      { return epsilon; }
+    static constexpr coord_t length()     { return epsilon; }
+
+    template<typename size_fn_t>
+    static constexpr coord_t degenerate(size_fn_t&&) { return epsilon; }
+
+    template<class vect_t>
+    static constexpr coord_t volume(const vect_t&) { return epsilon; }
+};
+
+/** @brief Relative_tolerance - distances are compared relative to the scale of the scene,
+ *  the distance tolerance is never less than the one of Absolute_tolerance,
+ *  degenerate values are compared relative to the lengths of their sides, so they do not depend on the scale
+ */
+template<class coord_t>
+class Relative_tolerance final {
+
+private:
+
+    coord_t length_ = epsilon;
+
+public:
+
+    static constexpr coord_t epsilon          = Tolerance_traits<coord_t>::epsilon;
+    static constexpr coord_t relative_epsilon = Tolerance_traits<coord_t>::relative_epsilon;
+
+    void set_scale(coord_t scale) {
+        length_ = std::max(epsilon, relative_epsilon * scale);
+    }
+
+    static constexpr coord_t ratio()      { return epsilon; }
+    coord_t                  length() const { return length_; }
+
+    template<typename size_fn_t>
+    static coord_t degenerate(size_fn_t&& size) { return epsilon * size(); }
+
+    /* the triple product is the distance to the plane multiplied by the length of 'cross' */
+    template<class vect_t>
+    coord_t volume(const vect_t& cross) const {
+        return length_ * std::sqrt(cross.count_dot(cross));
+    }
+};
+}
@@ -1,50 +1,49 @@
-#include "intersection_of_triangles.hpp"
+#include "kernels.hpp"
 
 #include <iostream>
-#include <cstdint>
-#include <memory>
-#include <set>
+#include <string>
+
+template<class coord_t>
+static int run(const std::string& tolerance, bool daemon) {
+
+    if (tolerance == "absolute")
+        return Geometry::run_intersection<coord_t, Geometry::Absolute_tolerance<coord_t>>(std::cin, std::cout, daemon);
+    if (tolerance == "relative")
+        return Geometry::run_intersection<coord_t, Geometry::Relative_tolerance<coord_t>>(std::cin, std::cout, daemon);
+
+    std::cout << "unknown tolerance " << tolerance << '\n';
+    return -1;
+}
 
 /** @name Intersection of triangles
  *  @brief main of a program 'intersection of trinagles'
  *  [in]  number of triangles
  *  [in]  coorinates of each triangle in 3d
  *  [out] indexes of triangles which intersect
+ *  --daemon: meshes stay in memory and serve commands from stdin (see Mesh_service)
+ *  --float:  float coordinates instead of double
+ *  --tolerance absolute | relative: policy of comparisons (see tolerance.hpp)
  *  @author Vekhov Vladimir
  */
-int main() {
-
-    Geometry::Triangle_intersection<double> tr_int;
-    Geometry::Optimisation<double> opt;
-
-    int64_t number_tr = 0;
-    
-    if (!(std::cin >> number_tr).good() || (number_tr <= 0)) {
-        std::cout << "incorrect input\n";
-        return -1;
-    }
-
-    double x1, y1, z1, x2, y2, z2, x3, y3, z3; 
-    for (int i = 0; i < number_tr; ++i) {
-
-        if (!(std::cin >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3).good()) {
-            std::cout << "incorrect input\n";
+int main(int argc, char* argv[]) {
+
+    bool        daemon    = false;
+    bool        use_float = false;
+    std::string tolerance = "absolute";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--daemon")
+            daemon = true;
+        else if (arg == "--float")
+            use_float = true;
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = argv[++i];
+        else {
+            std::cout << "usage: intersection.x [--daemon] [--float] [--tolerance absolute|relative]\n";
             return -1;
         }
-        Geometry::Triangle<double> tr({x1, y1, z1}, {x2, y2, z2}, {x3, y3, z3});
-        tr_int.add_triangle(tr);
     }
 
-    #ifndef NDEBUG
-        tr_int.intersect_all();
-    #endif
-    std::unique_ptr<Geometry::Optimisation<double>::BVH_node> bvh_root = opt.build_BVH(tr_int.triangle_array.begin(), 
-                                                                                       tr_int.triangle_array.end());
-
-    opt.check_BVH_intersection(bvh_root->left, bvh_root->right, tr_int);
-
-    for (uint64_t tr_num: tr_int.set_index)
-        std::cout << tr_num << std::endl; 
-
-    return 0;
+    return use_float ? run<float>(tolerance, daemon) : run<double>(tolerance, daemon);
 }
@@ -0,0 +1,37 @@
+#include "kernels.hpp"
+#include "mesh_index.hpp"
+#include "mesh_service.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Geometry {
+
+template<class coord_t, class tolerance_t>
+int run_intersection(std::istream& in, std::ostream& out, bool daemon) {
+
+    if (daemon) {
+        Mesh_service<coord_t, tolerance_t> service;
+        return service.run(in, out);
+    }
+
+    Mesh_index<coord_t, tolerance_t> mesh;
+    if (!mesh.load_mesh(in)) {
+        out << "incorrect input\n";
+        return -1;
+    }
+
+    std::vector<uint64_t> result;
+    mesh.query_self(result);
+
+    for (uint64_t tr_num: result)
+        out << tr_num << '\n'; 
+
+    return 0;
+}
+
+template int run_intersection<double, Absolute_tolerance<double>>(std::istream&, std::ostream&, bool);
+template int run_intersection<double, Relative_tolerance<double>>(std::istream&, std::ostream&, bool);
+template int run_intersection<float,  Absolute_tolerance<float>> (std::istream&, std::ostream&, bool);
+template int run_intersection<float,  Relative_tolerance<float>> (std::istream&, std::ostream&, bool);
+}
@@ -1,13 +1,41 @@
 #include "intersection_of_triangles.hpp"
+#include "mesh_index.hpp"
+#include "mesh_service.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <type_traits>
 #include <cstdlib>
 #include <set>
 #include <string>
 #include <functional>
 #include <cstdint>
 #include <memory>
+#include <new>
+
+/* allocations of the test program, repeated queries of a built index should not allocate */
+static uint64_t allocations = 0;
+
+void* operator new(std::size_t size) {
+
+    ++allocations;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
 
 static bool run_test(const Geometry::Triangle<double>& t1, const Geometry::Triangle<double>& t2, bool expected_result, 
                                                                                         const std::string& test_name);
@@ -35,12 +63,10 @@ bool run_test(const Geometry::Triangle<double>& t1, const Geometry::Triangle<dou
     }
 }
 
-bool run_big_test(const std::set<uint64_t> res_ref, const std::string& file_name) {
+bool run_big_test(const std::set<uint64_t> res_ref, const std::string& file_name, Geometry::Optimisation<double>& opt) {
 
     Geometry::Triangle_intersection<double> tr_int;
 
-    Geometry::Optimisation<double> opt;
-
     std::ifstream in_file;
     in_file.open(file_name);
     if (!in_file.is_open()) {
@@ -60,8 +86,8 @@ bool run_big_test(const std::set<uint64_t> res_ref, const std::string& file_name
     }
     in_file.close();
 
-    std::unique_ptr<Geometry::Optimisation<double>::BVH_node> bvh_root = opt.build_BVH(tr_int.triangle_array.begin(), 
-                                                                                       tr_int.triangle_array.end());
+    Geometry::Optimisation<double>::BVH_node* bvh_root = opt.build_BVH(tr_int.triangle_array.begin(), 
+                                                                       tr_int.triangle_array.end());
 
     opt.check_BVH_intersection(bvh_root->left, bvh_root->right, tr_int);
 
@@ -76,10 +102,393 @@ bool run_big_test(const std::set<uint64_t> res_ref, const std::string& file_name
         return true;
 }
 
+bool run_big_test(const std::set<uint64_t> res_ref, const std::string& file_name) {
+
+    Geometry::Optimisation<double> opt;
+
+    return run_big_test(res_ref, file_name, opt);
+}
+
+bool run_mesh_index_test(const std::set<uint64_t> res_ref, const std::string& file_name) {
+
+    Geometry::Mesh_index<double> mesh;
+
+    std::ifstream in_file(file_name);
+    if (!in_file.is_open() || !mesh.load_mesh(in_file)) {
+        std::cout << "Mesh index test failed\n";
+        return false;
+    }
+
+    std::vector<uint64_t> result;
+    mesh.query_self(result);
+    bool res = (std::set<uint64_t>(result.begin(), result.end()) == res_ref);
+
+    /* each triangle of the mesh intersects itself */
+    res = res && (mesh.query_other(mesh, result) == mesh.size());
+
+    Geometry::Triangle<double> tr = mesh.triangles().at(0);
+    mesh.query_triangle(tr, result);
+    res = res && (std::find(result.begin(), result.end(), 0) != result.end());
+
+    /* the tree of a moved index stays valid, the moved-from index is empty */
+    static_assert(!std::is_copy_constructible<Geometry::Mesh_index<double>>::value, "Mesh_index is move-only");
+    Geometry::Mesh_index<double> moved = std::move(mesh);
+    moved.query_self(result);
+    res = res && (std::set<uint64_t>(result.begin(), result.end()) == res_ref);
+    res = res && (mesh.size() == 0) && (mesh.query_self(result) == 0);
+
+    if (res != true) {
+        std::cout << "Mesh index test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_service_test() {
+
+    Geometry::Mesh_service<double> service;
+
+    std::istringstream in("load a 2  0 0 0  1 0 0  0 1 0   0.5 -1 0  0.5 1 0  -1 0.5 0\n"
+                          "load b 1  10 10 10  11 10 10  10 11 10\n"
+                          "self a\n"
+                          "other a b\n"
+                          "range a 2  0.2 0.2 -1  0.2 0.2 1  0 0.3 1   5 5 5  6 5 5  5 6 5\n"
+                          "quit\n");
+    std::ostringstream out;
+
+    bool res = (service.run(in, out) == 0) && (service.queries() == 4) &&
+               (out.str() == "ok 2\nok 1\n2 0 1\n0\n2 0 1\n0\n");
+    if (res != true) {
+        std::cout << "Service test failed\n" << out.str();
+        return false;
+    }
+    return true;
+}
+
+bool run_ray_test(const std::string& file_name) {
+
+    Geometry::Mesh_index<double> mesh;
+    Geometry::Triangle_intersection<double> tr_int;
+
+    std::ifstream in_file(file_name);
+    if (!in_file.is_open() || !mesh.load_mesh(in_file)) {
+        std::cout << "Ray test failed\n";
+        return false;
+    }
+
+    /* rays from points around the mesh to centers of its triangles */
+    std::vector<Geometry::Ray<double>> rays;
+    uint64_t seed = 1;
+    for (const Geometry::Triangle<double>& tr : mesh.triangles()) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        Geometry::Vect<double> origin(double(seed >> 40) / (1 << 18) - 32, double((seed >> 20) & 0xfffff) / (1 << 14) - 32, 
+                                      double(seed & 0xfffff) / (1 << 14) - 32);
+        rays.push_back({origin, (tr.a + tr.b + tr.c) / 3 - origin});
+    }
+
+    std::vector<Geometry::Hit<double>> hits;
+    mesh.cast_rays(rays.begin(), rays.end(), hits);
+
+    bool res = (hits.size() == rays.size());
+    for (size_t i = 0; res && i < rays.size(); ++i) {
+
+        Geometry::Hit<double> ref = {};
+        double t = 0;
+        for (const Geometry::Triangle<double>& tr : mesh.triangles()) {
+            if (tr_int.intersect_ray(rays[i].origin, rays[i].dir, tr, t) && 
+                (t < ref.distance || (t == ref.distance && tr.index < ref.index))) {
+                ref.index    = tr.index;
+                ref.distance = t;
+            }
+        }
+        Geometry::Hit<double> hit = mesh.cast_ray(rays[i]);
+
+        res = ref.found() && (hit.index == ref.index) && (hit.distance == ref.distance) &&
+                             (hits[i].index == ref.index) && (hits[i].distance == ref.distance);
+    }
+
+    /* nearest triangles to the origins of the rays */
+    for (size_t i = 0; res && i < rays.size(); ++i) {
+
+        Geometry::Hit<double> ref = {};
+        for (const Geometry::Triangle<double>& tr : mesh.triangles()) {
+            Geometry::Vect<double> diff = tr.closest_point(rays[i].origin) - rays[i].origin;
+            double distance = std::sqrt(diff.count_dot(diff));
+            if (distance < ref.distance) {
+                ref.index    = tr.index;
+                ref.distance = distance;
+            }
+        }
+        res = (mesh.query_nearest(rays[i].origin).distance == ref.distance);
+    }
+
+    if (res != true) {
+        std::cout << "Ray test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_ray_tie_test(const std::string& file_name) {
+
+    Geometry::Mesh_index<double> mesh;
+    Geometry::Triangle_intersection<double> tr_int;
+
+    std::ifstream in_file(file_name);
+    if (!in_file.is_open() || !mesh.load_mesh(in_file)) {
+        std::cout << "Ray tie test failed\n";
+        return false;
+    }
+
+    /* rays to vertices and middles of sides: triangles sharing them are hit at the same t,
+       directions of the first half have the same signs, so cast_rays traverses them by packets */
+    std::vector<Geometry::Ray<double>> rays;
+    uint64_t seed = 7;
+    for (size_t i = 0; i < 3000; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const Geometry::Triangle<double>& tr = mesh.triangles().at((seed >> 33) % mesh.size());
+        Geometry::Vect<double> target = (i % 2) ? tr.a : (tr.a + tr.b) / 2;
+        Geometry::Vect<double> offset(double(seed & 0xffff) / 100 + 1, double((seed >> 16) & 0xffff) / 100 + 1, 
+                                      double((seed >> 48) & 0xffff) / 100 + 1);
+        Geometry::Vect<double> origin = (i < 1500) ? target - offset : offset - Geometry::Vect<double>(300, 300, 300);
+        rays.push_back({origin, target - origin});
+    }
+
+    std::vector<Geometry::Hit<double>> hits;
+    mesh.cast_rays(rays.begin(), rays.end(), hits);
+
+    bool res = true;
+    for (size_t i = 0; res && i < rays.size(); ++i) {
+
+        Geometry::Hit<double> ref = {};
+        double t = 0;
+        for (const Geometry::Triangle<double>& tr : mesh.triangles()) {
+            if (tr_int.intersect_ray(rays[i].origin, rays[i].dir, tr, t) && 
+                (t < ref.distance || (t == ref.distance && tr.index < ref.index))) {
+                ref.index    = tr.index;
+                ref.distance = t;
+            }
+        }
+        res = (mesh.cast_ray(rays[i]).index == ref.index) && (hits[i].index == ref.index);
+    }
+    if (res != true) {
+        std::cout << "Ray tie test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_box_test() {
+
+    Geometry::Mesh_index<double> mesh;
+    mesh.add_triangle(Geometry::Triangle<double>({0, 0, 0}, {1, 0, 0}, {0, 1, 0}));
+    mesh.add_triangle(Geometry::Triangle<double>({3, 0, 0}, {0, 3, 0}, {3, 3, 0}));    // its AABB covers the box
+    mesh.add_triangle(Geometry::Triangle<double>({1, 1, 1}, {2, 1, 1}, {1, 2, 1}));    // touches the box
+    mesh.add_triangle(Geometry::Triangle<double>({5, 5, 5}, {6, 5, 5}, {5, 6, 5}));
+
+    std::vector<uint64_t> result;
+    mesh.query_box({0.5, 0.5, -1}, {1, 1, 1}, result);
+
+    bool res = (result == std::vector<uint64_t>{0, 2});
+
+    Geometry::Hit<double> hit = mesh.cast_ray({{0.2, 0.2, 10}, {0, 0, -1}});
+    res = res && (hit.index == 0) && (hit.distance == 10);
+
+    hit = mesh.cast_ray({{0.2, 0.2, 10}, {0, 0, 1}});
+    res = res && !hit.found();
+
+    hit = mesh.query_nearest({5.2, 5.2, 7});
+    res = res && (hit.index == 3) && (hit.distance == 2);
+
+    /* the top side of a vertical triangle lies in the max face of its box, the ray goes along the face */
+    Geometry::Mesh_index<double> wall;
+    wall.add_triangle(Geometry::Triangle<double>({0, 0, 0}, {1, 0, 0}, {0, 1, 0}));
+    wall.add_triangle(Geometry::Triangle<double>({0.5, -1, 1}, {0.5, 1, 1}, {0.5, 0, -1}));
+
+    hit = wall.cast_ray({{-5, 0, 1}, {1, 0, 0}});
+    res = res && (hit.index == 1) && (hit.distance == 5.5);
+
+    std::vector<Geometry::Hit<double>> hits;
+    std::vector<Geometry::Ray<double>> rays = {{{-5, 0, 1}, {1, 0, 0}}};
+    wall.cast_rays(rays.begin(), rays.end(), hits);
+    res = res && (hits.at(0).index == 1);
+
+    if (res != true) {
+        std::cout << "Box test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_relative_tolerance_test(double offset) {
+
+    /* coplanar triangles, one inside another, in a tilted plane far from the origin */
+    Geometry::Vect<double> u(1, 0.3, 0.2), v(-0.2, 1, 0.45);
+
+    bool res = true;
+    for (int k = 0; res && k < 50; ++k) {
+
+        double size = 1 + k * 0.37;
+        Geometry::Vect<double> origin(offset + k, offset * 0.7 - k, offset * 0.3 + 2 * k);
+        auto point = [&](double a, double b) { return origin + u * (a * size) + v * (b * size); };
+
+        Geometry::Mesh_index<double, Geometry::Relative_tolerance<double>> mesh;
+        mesh.add_triangle(Geometry::Triangle<double>(point(0, 0), point(4, 0), point(2, 4)));
+        mesh.add_triangle(Geometry::Triangle<double>(point(1, 1), point(3, 1), point(2, 2.5)));
+
+        std::vector<uint64_t> result;
+        res = (mesh.query_self(result) == 2);
+    }
+    if (res != true) {
+        std::cout << "Relative tolerance test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_small_scale_test(double scale) {
+
+    /* the second triangle pierces the first one, the third one is apart */
+    Geometry::Mesh_index<double, Geometry::Relative_tolerance<double>> mesh;
+    mesh.add_triangle(Geometry::Triangle<double>({0, 0, 0}, {scale, 0, 0}, {0, scale, 0}));
+    mesh.add_triangle(Geometry::Triangle<double>({0.2 * scale, 0.2 * scale, -0.5 * scale}, 
+                                                 {0.2 * scale, 0.2 * scale, 0.5 * scale}, {0.6 * scale, 0.2 * scale, 0}));
+    mesh.add_triangle(Geometry::Triangle<double>({0, 0, scale}, {scale, 0, scale}, {0, scale, 2 * scale}));
+
+    std::vector<uint64_t> result;
+    bool res = (mesh.query_self(result) == 2) && (result == std::vector<uint64_t>{0, 1});
+
+    Geometry::Hit<double> hit = mesh.cast_ray({{0.1 * scale, 0.1 * scale, -scale}, {0, 0, scale}});
+    res = res && (hit.index == 0) && (std::fabs(hit.distance - 1) < 1e-9);
+
+    if (res != true) {
+        std::cout << "Small scale test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_float_test(const std::set<uint64_t> res_ref, const std::string& file_name) {
+
+    Geometry::Mesh_index<float> mesh;
+
+    std::ifstream in_file(file_name);
+    if (!in_file.is_open() || !mesh.load_mesh(in_file)) {
+        std::cout << "Float test failed\n";
+        return false;
+    }
+
+    std::vector<uint64_t> result;
+    mesh.query_self(result);
+
+    if (std::set<uint64_t>(result.begin(), result.end()) != res_ref) {
+        std::cout << "Float test failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_service_error_test() {
+
+    Geometry::Mesh_service<double> service;
+
+    std::istringstream in("load a 2  0 0 0  1 0 0  0 1 0   0.5 -1 0  0.5 1 0  -1 0.5 0\n"
+                          "load a 2  0 0 x\n"
+                          "self a\n"
+                          "self\n"
+                          "unknown a b c\n"
+                          "self c\n"
+                          "ray a 4000000000000000000 0 0 -1 0 0 1 x\n"
+                          "nearest a 3000000000 0 0 0 x\n"
+                          "self a\n");
+    std::ostringstream out;
+
+    bool res = (service.run(in, out) == 0) && 
+               (out.str() == "ok 2\nerror incorrect input\n2 0 1\nerror incorrect input\n"
+                             "error unknown command unknown\nerror unknown mesh c\n"
+                             "error incorrect input\nerror incorrect input\n2 0 1\n");
+    if (res != true) {
+        std::cout << "Service error test failed\n" << out.str();
+        return false;
+    }
+    return true;
+}
+
+bool run_allocation_test(const std::string& file_name) {
+
+    Geometry::Mesh_index<double> mesh;
+
+    std::ifstream in_file(file_name);
+    if (!in_file.is_open() || !mesh.load_mesh(in_file)) {
+        std::cout << "Allocation test failed\n";
+        return false;
+    }
+
+    std::vector<uint64_t> result;
+    std::vector<Geometry::Hit<double>> hits;
+    std::vector<Geometry::Ray<double>> rays = {{{-300, -300, -300}, {1, 1, 1}}, {{300, 0, 0}, {-1, 0.1, 0}}};
+    const Geometry::Triangle<double> tr = mesh.triangles().at(0);
+
+    auto run_queries = [&]() {
+        mesh.query_self(result);
+        mesh.query_triangle(tr, result);
+        mesh.query_box({-10, -10, -10}, {10, 10, 10}, result);
+        mesh.query_nearest({1, 2, 3});
+        mesh.cast_ray(rays.at(0));
+        mesh.cast_rays(rays.begin(), rays.end(), hits);
+    };
+
+    /* the first queries build the index and grow the buffers */
+    run_queries();
+
+    uint64_t before = allocations;
+    for (int i = 0; i < 3; ++i)
+        run_queries();
+
+    if (allocations != before) {
+        std::cout << "Allocation test failed: " << allocations - before << " allocations\n";
+        return false;
+    }
+    return true;
+}
+
+bool run_service_reload_test() {
+
+    Geometry::Mesh_service<double> service;
+
+    const std::string coordinates = "0 0 0  1 0 0  0 1 0   0.5 -1 0  0.5 1 0  -1 0.5 0\n";
+    const std::string load        = "load a 2  " + coordinates;
+
+    std::istringstream first_in(load + "self a\n" + load + "self a\n");
+    std::istringstream second_in(load + "self a\n");
+    std::istringstream numbers_in(coordinates);
+    std::ostringstream out;
+    std::ostream       null_out(nullptr);
+
+    /* the second load takes the buffers of the first mesh, so the third one reuses them */
+    bool res = (service.run(first_in, out) == 0) && (out.str() == "ok 2\n2 0 1\nok 2\n2 0 1\n");
+
+    /* reading floating point numbers may allocate inside the standard library */
+    uint64_t before = allocations;
+    double   number = 0;
+    while (numbers_in >> number) {}
+    uint64_t read_allocations = allocations - before;
+
+    before = allocations;
+    service.run(second_in, null_out);
+    res = res && (allocations - before == read_allocations);
+
+    if (res != true) {
+        std::cout << "Service reload test failed\n" << out.str();
+        return false;
+    }
+    return true;
+}
+
 int run_tests() {
 
     uint64_t       test_counter = 0;
-    const uint64_t Test_num     = 18;
+    const uint64_t Test_num     = 30;
 
     // Test 1: Triangles intersect
     Geometry::Triangle<double> triangle1({1, 1, 1}, {4, 1, 1}, {2.5, 4, 1});
@@ -167,6 +576,34 @@ int run_tests() {
                                    56, 59, 61, 62, 67, 71, 74, 77, 86, 87, 93, 96, 98};
     test_counter += run_big_test(res_ref2, "tests/test3.txt");
 
+    // Test 19: one Optimisation object reused for several builds
+    Geometry::Optimisation<double> opt;
+    test_counter += (run_big_test(res_ref2, "tests/test3.txt", opt) && run_big_test(res_ref1, "tests/test.txt", opt) &&
+                     run_big_test(res_ref2, "tests/test3.txt", opt));
+
+    // Test 20: library API, repeated queries without allocations
+    test_counter += run_mesh_index_test(res_ref2, "tests/test3.txt");
+    test_counter += run_allocation_test("tests/test2.txt");
+
+    // Test 21: commands of the long-lived mode, incorrect commands
+    test_counter += run_service_test();
+    test_counter += run_service_error_test();
+    test_counter += run_service_reload_test();
+
+    // Test 22: ray casts and nearest triangles compared with brute force, ties of triangles
+    test_counter += run_ray_test("tests/test3.txt");
+    test_counter += run_ray_tie_test("tests/test2.txt");
+
+    // Test 23: box query, ray casts and nearest triangle on a small mesh
+    test_counter += run_box_test();
+
+    // Test 24: coplanar triangles with large coordinates, crossing triangles with small ones
+    test_counter += run_relative_tolerance_test(1e6);
+    test_counter += run_small_scale_test(1e-3);
+
+    // Test 25: float coordinates
+    test_counter += run_float_test(res_ref2, "tests/test3.txt");
+
     if (test_counter == Test_num) {
         std::cout << "All tests passed!" << std::endl;
         return 0;